@@ -2,6 +2,12 @@
 
 #include "ASAnimGraphNode_FABRIK.h"
 
+/// UE4
+#include "Animation/AnimBlueprint.h"
+#include "Animation/AnimInstance.h"
+#include "Components/SkeletalMeshComponent.h"
+#include "SceneManagement.h"
+
 #define LOCTEXT_NAMESPACE "IKSolverNodes"
 
 UASAnimGraphNode_FABRIK::UASAnimGraphNode_FABRIK(const FObjectInitializer& ObjectInitializer)
@@ -25,7 +31,25 @@ FString UASAnimGraphNode_FABRIK::GetNodeCategory() const
 
 FText UASAnimGraphNode_FABRIK::GetNodeTitle(ENodeTitleType::Type TitleType) const
 {
-	return LOCTEXT("Custom FABRIK", "Custom FABRIK");
+	const FText Title = LOCTEXT("Custom FABRIK", "Custom FABRIK");
+
+	// Append live solver cost while an instance is being debugged
+	const FASAnimNode_FABRIK* DebuggedNode = TitleType == ENodeTitleType::FullTitle && Node.bProfile ? GetDebuggedNode() : nullptr;
+	if (DebuggedNode == nullptr)
+	{
+		return Title;
+	}
+
+	const FASAnimNode_FABRIK::FDebugStats& Stats = DebuggedNode->GetDebugStats();
+	FNumberFormattingOptions CostFormat;
+	CostFormat.SetMaximumFractionalDigits(1);
+
+	FFormatNamedArguments Args;
+	Args.Add(TEXT("Title"), Title);
+	Args.Add(TEXT("Cost"), FText::AsNumber(Stats.AverageMicroseconds, &CostFormat));
+	Args.Add(TEXT("Iterations"), FText::AsNumber(Stats.LastIterations));
+	Args.Add(TEXT("Failures"), FText::AsNumber(Stats.ConvergenceFailures));
+	return FText::Format(LOCTEXT("FABRIKProfiledTitle", "{Title}\n{Cost} us | {Iterations} iterations | {Failures} failures"), Args);
 }
 
 FText UASAnimGraphNode_FABRIK::GetControllerDescription() const
@@ -33,4 +57,52 @@ FText UASAnimGraphNode_FABRIK::GetControllerDescription() const
 	return LOCTEXT("Custom FABRIK", "Custom FABRIK");
 }
 
+void UASAnimGraphNode_FABRIK::Draw(FPrimitiveDrawInterface* PDI, USkeletalMeshComponent* PreviewSkelMeshComp) const
+{
+	if (PreviewSkelMeshComp == nullptr)
+	{
+		return;
+	}
+
+	const FASAnimNode_FABRIK* ActiveNode = GetActiveInstanceNode<FASAnimNode_FABRIK>(PreviewSkelMeshComp->GetAnimInstance());
+	if (ActiveNode == nullptr || !ActiveNode->bProfile)
+	{
+		return;
+	}
+
+	const FASAnimNode_FABRIK::FDebugStats& Stats = ActiveNode->GetDebugStats();
+	const FTransform& ComponentTransform = PreviewSkelMeshComp->GetComponentTransform();
+
+	// Chain segments go from green to red as the cost approaches the budget
+	const float CostAlpha = FMath::Clamp(Stats.AverageMicroseconds / CostBudgetMicroseconds, 0.f, 1.f);
+	const FLinearColor CostColor = FLinearColor::LerpUsingHSV(FLinearColor::Green, FLinearColor::Red, CostAlpha);
+
+	for (int32 Index = 1; Index < Stats.ChainLocations.Num(); ++Index)
+	{
+		const FVector Start = ComponentTransform.TransformPosition(Stats.ChainLocations[Index - 1]);
+		const FVector End = ComponentTransform.TransformPosition(Stats.ChainLocations[Index]);
+		PDI->DrawLine(Start, End, CostColor, SDPG_Foreground, 1.f);
+	}
+
+	// The effector shows the residual error, relative to the tolerance the solver actually used
+	if (Stats.ChainLocations.Num() > 0)
+	{
+		const float ResidualAlpha = FMath::Clamp(Stats.LastResidual / FMath::Max(Stats.SolverTolerance, KINDA_SMALL_NUMBER) - 1.f, 0.f, 1.f);
+		const FLinearColor ResidualColor = FLinearColor::LerpUsingHSV(FLinearColor::Green, FLinearColor::Red, ResidualAlpha);
+		const FVector EffectorLocation = ComponentTransform.TransformPosition(Stats.ChainLocations.Last());
+		DrawWireSphere(PDI, EffectorLocation, ResidualColor, 3.f, 12, SDPG_Foreground);
+	}
+}
+
+const FASAnimNode_FABRIK* UASAnimGraphNode_FABRIK::GetDebuggedNode() const
+{
+	UAnimBlueprint* AnimBlueprint = GetAnimBlueprint();
+	if (AnimBlueprint == nullptr)
+	{
+		return nullptr;
+	}
+
+	return GetActiveInstanceNode<FASAnimNode_FABRIK>(AnimBlueprint->GetObjectBeingDebugged());
+}
+
 #undef LOCTEXT_NAMESPACE
\ No newline at end of file
@@ -28,9 +28,18 @@ public:
 	virtual FString GetNodeCategory() const override;
 	virtual FText GetNodeTitle(ENodeTitleType::Type TitleType) const override;
 	FText GetControllerDescription() const;
+	virtual void Draw(FPrimitiveDrawInterface* PDI, USkeletalMeshComponent* PreviewSkelMeshComp) const override;
 	// ~End UAnimGraphNode_SkeletalControlBase Interface
 
 	/** The FABRIK controller this Graph node is holding */
 	UPROPERTY(EditAnywhere, Category = Skeletal)
 	FASAnimNode_FABRIK Node;
+
+	/** Evaluation cost, in microseconds, at which the viewport overlay draws the chain fully red */
+	UPROPERTY(EditAnywhere, Category = Profiling, meta = (ClampMin = "1.0"))
+	float CostBudgetMicroseconds = 50.f;
+
+private:
+	/** Runtime node of the instance currently being debugged, if any */
+	const FASAnimNode_FABRIK* GetDebuggedNode() const;
 };
@@ -2,15 +2,16 @@
 
 #include "ASAnimNode_FABRIK.h"
 
+/// UE4
+#include "Algo/Reverse.h"
+
 /// Animation
 #include "Animation/AnimInstanceProxy.h"
 
 /// AnimSolvers
 #include "ASBoneData.h"
-
-#if WITH_EDITOR
-#include "DrawDebugHelpers.h"
-#endif // WITH_EDITOR
+#include "ASFABRIKCapture.h"
+#include "ASSolverSettings.h"
 
 DECLARE_STATS_GROUP(TEXT("AnimSolvers"), STATGROUP_ANIMSOLVERS, STATCAT_Advanced);
 DECLARE_CYCLE_STAT(TEXT("FABRIK_EvaluateSkeletalControl"), STAT_FABRIK_EvaluateSkeletalControl, STATGROUP_ANIMSOLVERS);
@@ -59,15 +60,16 @@ namespace FABRIKSolver
 		}
 	}
 
-	void SolveFABRIK(const TArray<FASBoneData>& InBoneDataArr, const FVector& TargetLocation, const float& InPrecision, const int32 InMaxIteration, TArray<FTransform>& OutBoneTransforms)
+	FASFABRIKSolveResult SolveFABRIK(const TArray<FASBoneData>& InBoneDataArr, const FVector& TargetLocation, const float& InPrecision, const int32 InMaxIteration, TArray<FTransform>& OutBoneTransforms)
 	{
+		FASFABRIKSolveResult Result;
 		if (InBoneDataArr.Num() <= 1) 
 		{
-			return;
+			return Result;
 		}
 
-		OutBoneTransforms.Empty();
-		OutBoneTransforms.Reserve(InBoneDataArr.Num());
+		// Reset keeps the allocation, so callers can reuse the same output array across solves
+		OutBoneTransforms.Reset(InBoneDataArr.Num());
 		for (const FASBoneData& InBoneData : InBoneDataArr)
 		{
 			OutBoneTransforms.Add(InBoneData.BoneTransform);
@@ -77,7 +79,8 @@ namespace FABRIKSolver
 		float TargetOffset = FVector::Dist(TargetLocation, EffectorBoneTransform.GetLocation());
 		if (TargetOffset < InPrecision)
 		{
-			return;
+			Result.Residual = TargetOffset;
+			return Result;
 		}
 
 		// First step : we set the end effector's bone location to the specified location.
@@ -99,6 +102,33 @@ namespace FABRIKSolver
 
 			TargetOffset = FVector::Dist(TargetLocation, EffectorBoneTransform.GetLocation());
 		}
+
+		Result.Iterations = FMath::Min(Count, InMaxIteration);
+		Result.Residual = TargetOffset;
+		Result.bConverged = TargetOffset <= InPrecision;
+		return Result;
+	}
+	void ApplyChainRotations(const TArray<FASBoneData>& InBoneData, TArray<FTransform>& OutBoneTransforms)
+	{
+		const int32 NumBones = FMath::Min(InBoneData.Num(), OutBoneTransforms.Num());
+		for (int32 Index = 0; Index < NumBones - 1; ++Index)
+		{
+			const FTransform& OldParentTransform = InBoneData[Index].BoneTransform;
+			const FTransform& OldChildTransform = InBoneData[Index + 1].BoneTransform;
+
+			const FVector OldDir = (OldChildTransform.GetTranslation() - OldParentTransform.GetTranslation()).GetUnsafeNormal();
+
+			const FTransform& ParentTransform = OutBoneTransforms[Index];
+			const FTransform& ChildTransform = OutBoneTransforms[Index + 1];
+
+			const FVector NewDir = (ChildTransform.GetTranslation() - ParentTransform.GetTranslation()).GetUnsafeNormal();
+			const FVector Axis = FVector::CrossProduct(OldDir, NewDir).GetSafeNormal();
+			const float Angle = FMath::Acos(FVector::DotProduct(OldDir, NewDir));
+			const FQuat DeltaRot(Axis, Angle);
+
+			OutBoneTransforms[Index].SetRotation(DeltaRot * OutBoneTransforms[Index].GetRotation());
+			OutBoneTransforms[Index].NormalizeRotation();
+		}
 	}
 }
 
@@ -106,95 +136,212 @@ void FASAnimNode_FABRIK::EvaluateSkeletalControl_AnyThread(FComponentSpacePoseCo
 {
 	SCOPE_CYCLE_COUNTER(STAT_FABRIK_EvaluateSkeletalControl);
 
-	const USkeletalMeshComponent* SkmCmp = Output.AnimInstanceProxy->GetSkelMeshComponent();
-	if (!ensure(SkmCmp))
-	{
-		return;
-	}
-	
+#if WITH_EDITORONLY_DATA
+	const uint64 StartCycles = bProfile ? FPlatformTime::Cycles64() : 0;
+#endif // WITH_EDITORONLY_DATA
+
 	// Get all bone indices to compose our bone chain
-	TArray<FCompactPoseBoneIndex> BoneIndices;
-	if(!FillBoneIndices(Output, BoneIndices))
+	// A single bone chain leaves nothing for the solver to do
+	if(!FillBoneIndices(Output, BoneIndices) || BoneIndices.Num() <= 1)
 	{
 		return;
 	}
 
 	// Build bones data used by the FABRIK Solver
-	TArray<FASBoneData> BonesToModify;
 	BuildBoneData(BoneIndices, Output, BonesToModify);
 
-	TArray<FTransform> ModifiedBoneTransforms;
-	FABRIKSolver::SolveFABRIK(BonesToModify, TargetLocation, Tolerance, MaxIteration, ModifiedBoneTransforms);
+	const FASSolverSettings& Settings = FASSolverSettings::Get();
+	const float SolverTolerance = Settings.ScaleTolerance(Tolerance);
+	const int32 SolverMaxIteration = Settings.ScaleMaxIteration(MaxIteration);
+
+	const FASFABRIKSolveResult SolveResult = FABRIKSolver::SolveFABRIK(BonesToModify, FilteredTargetLocation, SolverTolerance, SolverMaxIteration, ModifiedBoneTransforms);
 
 	// Once the FABRIK algorithm has computed the new locations for our bone chain,
 	// We need to adjust the modified bone angles to re-build our bone hierarchy 
-	for (int32 Index = 0; Index < BoneIndices.Num() - 1; ++Index)
-	{
-		const FTransform& OldParentTransform = BonesToModify[Index].BoneTransform;
-		const FTransform& OldChildTransform = BonesToModify[Index + 1].BoneTransform;
-
-		const FVector OldDir = (OldChildTransform.GetTranslation() - OldParentTransform.GetTranslation()).GetUnsafeNormal();
+	FABRIKSolver::ApplyChainRotations(BonesToModify, ModifiedBoneTransforms);
 
-		const FTransform& ParentTransform = ModifiedBoneTransforms[Index];
-		const FTransform& ChildTransform = ModifiedBoneTransforms[Index + 1];
-
-		const FVector NewDir = (ChildTransform.GetTranslation() - ParentTransform.GetTranslation()).GetUnsafeNormal();
-		const FVector Axis = FVector::CrossProduct(OldDir, NewDir).GetSafeNormal();
-		const float Angle = FMath::Acos(FVector::DotProduct(OldDir, NewDir));
-		const FQuat DeltaRot(Axis, Angle);
+	// Send the new bone transforms
+	const int32 NumBones = BoneIndices.Num();
+	OutBoneTransforms.Reserve(OutBoneTransforms.Num() + NumBones);
+	for (int32 Index = 0; Index < NumBones; ++Index)
+	{
+		OutBoneTransforms.Emplace(BoneIndices[Index], ModifiedBoneTransforms[Index]);
+	}
 
-		ModifiedBoneTransforms[Index].SetRotation(DeltaRot * ModifiedBoneTransforms[Index].GetRotation());
-		ModifiedBoneTransforms[Index].NormalizeRotation();
+#if WITH_EDITORONLY_DATA
+	// Feed the editor profiler. The cost is smoothed so the graph node shows a readable value
+	if (bProfile)
+	{
+		const float Microseconds = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StartCycles) * 1000.0;
+		DebugStats.AverageMicroseconds = FMath::Lerp(DebugStats.AverageMicroseconds, Microseconds, 0.1f);
+		DebugStats.LastIterations = SolveResult.Iterations;
+		DebugStats.LastResidual = SolveResult.Residual;
+		DebugStats.SolverTolerance = SolverTolerance;
+		DebugStats.ConvergenceFailures += SolveResult.bConverged ? 0 : 1;
+
+		DebugStats.ChainLocations.Reset(NumBones);
+		for (const FTransform& BoneTransform : ModifiedBoneTransforms)
+		{
+			DebugStats.ChainLocations.Add(BoneTransform.GetTranslation());
+		}
 	}
+#endif // WITH_EDITORONLY_DATA
 
-	// Send the new bone transforms
-	for (int32 Index = 0; Index < BoneIndices.Num(); ++Index)
+#if AS_FABRIK_CAPTURE
+	// Recorded after the profiler stops timing, so capture writes do not inflate the displayed cost
+	FASFABRIKCapture& Capture = FASFABRIKCapture::Get();
+	if (Capture.IsCapturing())
 	{
-		OutBoneTransforms.Add(FBoneTransform(BoneIndices[Index], ModifiedBoneTransforms[Index]));
+		Capture.RecordSolve(this, FromBone.BoneName, ToBone.BoneName, BonesToModify, FilteredTargetLocation, SolverTolerance, SolverMaxIteration);
 	}
+#endif // AS_FABRIK_CAPTURE
 
-#if WITH_EDITOR && UE_ALLOW_DEBUG
+#if WITH_EDITORONLY_DATA && ENABLE_ANIM_DRAW_DEBUG
+	// Draw requests are queued on the anim instance proxy and flushed on the game thread,
+	// so the worker thread never touches the world. Only our own chain is drawn
 	if (bDrawDebug)
 	{
-		const UWorld* World = SkmCmp->GetWorld();
-		const FMatrix SkmToWorld = SkmCmp->GetComponentToWorld().ToMatrixNoScale();
+		FAnimInstanceProxy* AnimInstanceProxy = Output.AnimInstanceProxy;
+		const FTransform& ComponentTransform = AnimInstanceProxy->GetComponentTransform();
 
-		if (BonesToModify.Num() > 0)
+		for (int32 Index = 0; Index < NumBones; ++Index)
 		{
-			const FVector FirstBoneLocation = BonesToModify[0].BoneTransform.GetTranslation();
-			DrawDebugSphere(World, SkmToWorld.TransformPosition(FirstBoneLocation), 5.f, 10, FColor::Blue);
+			const FVector InputLocation = ComponentTransform.TransformPosition(BonesToModify[Index].BoneTransform.GetTranslation());
+			const FVector SolvedLocation = ComponentTransform.TransformPosition(ModifiedBoneTransforms[Index].GetTranslation());
+			AnimInstanceProxy->AnimDrawDebugSphere(InputLocation, 5.f, 10, FColor::Blue);
+			AnimInstanceProxy->AnimDrawDebugSphere(SolvedLocation, 5.f, 10, FColor::Red);
 
-			const int32 BoneCount = BonesToModify.Num();
-			for (int32 Index = 1; Index < BoneCount; ++Index)
+			if (Index > 0)
 			{
-				const FVector& Start = BonesToModify[Index - 1].BoneTransform.GetTranslation();
-				const FVector& End = BonesToModify[Index].BoneTransform.GetTranslation();
-				DrawDebugSphere(World, SkmToWorld.TransformPosition(End), 5.f, 10, FColor::Blue);
-				DrawDebugLine(World, SkmToWorld.TransformPosition(Start), SkmToWorld.TransformPosition(End), FColor::Yellow);
+				const FVector InputParentLocation = ComponentTransform.TransformPosition(BonesToModify[Index - 1].BoneTransform.GetTranslation());
+				const FVector SolvedParentLocation = ComponentTransform.TransformPosition(ModifiedBoneTransforms[Index - 1].GetTranslation());
+				AnimInstanceProxy->AnimDrawDebugLine(InputParentLocation, InputLocation, FColor::Yellow);
+				AnimInstanceProxy->AnimDrawDebugLine(SolvedParentLocation, SolvedLocation, FColor::Yellow);
 			}
 		}
+	}
+#endif // WITH_EDITORONLY_DATA && ENABLE_ANIM_DRAW_DEBUG
+}
 
-		if (OutBoneTransforms.Num() > 0)
-		{
-			const FVector FirstBoneLocation = BonesToModify[0].BoneTransform.GetTranslation();
-			DrawDebugSphere(World, SkmToWorld.TransformPosition(FirstBoneLocation), 5.f, 10, FColor::Red);
+bool FASAnimNode_FABRIK::IsValidToEvaluate(const USkeleton* Skeleton, const FBoneContainer& RequiredBones)
+{
+	return FASSolverSettings::Get().bEnabled && FromBone.IsValidToEvaluate(RequiredBones) && ToBone.IsValidToEvaluate(RequiredBones);
+}
 
-			const int32 BoneCount = OutBoneTransforms.Num();
-			for (int32 Index = 1; Index < BoneCount; ++Index)
-			{
-				const FVector& Start = OutBoneTransforms[Index - 1].Transform.GetTranslation();
-				const FVector& End = OutBoneTransforms[Index].Transform.GetTranslation();
-				DrawDebugSphere(World, SkmToWorld.TransformPosition(End), 5.f, 10, FColor::Red);
-				DrawDebugLine(World, SkmToWorld.TransformPosition(Start), SkmToWorld.TransformPosition(End), FColor::Yellow);
-			}
-		}
+void FASAnimNode_FABRIK::Initialize_AnyThread(const FAnimationInitializeContext& Context)
+{
+	FAnimNode_SkeletalControlBase::Initialize_AnyThread(Context);
+
+	bTargetFilterInitialized = false;
+	FilteredTargetLocation = TargetLocation;
+	FilteredTargetVelocity = FVector::ZeroVector;
+
+#if WITH_EDITORONLY_DATA
+	DebugStats = FDebugStats();
+#endif // WITH_EDITORONLY_DATA
+}
+
+void FASAnimNode_FABRIK::UpdateInternal(const FAnimationUpdateContext& Context)
+{
+	FAnimNode_SkeletalControlBase::UpdateInternal(Context);
+
+	// Restart the filter if we were not updated last frame, its state could be seconds old
+	const FGraphTraversalCounter& ProxyUpdateCounter = Context.AnimInstanceProxy->GetUpdateCounter();
+	if (!UpdateCounter.WasSynchronizedCounter(ProxyUpdateCounter))
+	{
+		bTargetFilterInitialized = false;
 	}
-#endif // WITH_EDITOR && UE_ALLOW_DEBUG
+	UpdateCounter.SynchronizeWith(ProxyUpdateCounter);
+
+	// Exposed inputs have been evaluated at this point, so TargetLocation is up to date
+	UpdateTargetFilter(Context.AnimInstanceProxy->GetComponentTransform(), Context.GetDeltaTime());
 }
 
-bool FASAnimNode_FABRIK::IsValidToEvaluate(const USkeleton* Skeleton, const FBoneContainer& RequiredBones)
+bool FASAnimNode_FABRIK::NeedsDynamicReset() const
+{
+	return TargetFilter != EASTargetFilter::None;
+}
+
+void FASAnimNode_FABRIK::ResetDynamics(ETeleportType InTeleportType)
+{
+	// A teleport would otherwise be seen as a huge target velocity, or drag the filtered target across the jump
+	bTargetFilterInitialized = false;
+}
+
+void FASAnimNode_FABRIK::UpdateTargetFilter(const FTransform& InComponentTransform, float InDeltaTime)
 {
-	return FromBone.IsValidToEvaluate(RequiredBones) && ToBone.IsValidToEvaluate(RequiredBones);
+	if (TargetFilter == EASTargetFilter::None)
+	{
+		FilteredTargetLocation = TargetLocation;
+		return;
+	}
+
+	if (TargetFilter == EASTargetFilter::Prediction)
+	{
+		// The pose will be displayed once the component has moved further, and a target anchored in the world
+		// drifts against that motion in component space, root motion turns being the worst offenders.
+		// We extrapolate the component's last motion, translation and rotation, over the prediction horizon
+		FTransform PredictedComponentTransform = InComponentTransform;
+		if (bTargetFilterInitialized && InDeltaTime > 0.f)
+		{
+			const float Rate = PredictionTime / InDeltaTime;
+			const FTransform ComponentDelta = InComponentTransform.GetRelativeTransform(PreviousComponentTransform);
+
+			FVector DeltaAxis;
+			float DeltaAngle = 0.f;
+			ComponentDelta.GetRotation().ToAxisAndAngle(DeltaAxis, DeltaAngle);
+			DeltaAngle = FMath::UnwindRadians(DeltaAngle);
+			const FTransform PredictedDelta(FQuat(DeltaAxis, DeltaAngle * Rate), ComponentDelta.GetTranslation() * Rate);
+
+			PredictedComponentTransform = PredictedDelta * InComponentTransform;
+		}
+
+		const FVector WorldTarget = InComponentTransform.TransformPosition(TargetLocation);
+		FilteredTargetLocation = PredictedComponentTransform.InverseTransformPosition(WorldTarget);
+		PreviousComponentTransform = InComponentTransform;
+		bTargetFilterInitialized = true;
+		return;
+	}
+
+	// Filter state is kept in the filter space, and only converted back to component space for the solver
+	const FVector RawTarget = bFilterInWorldSpace ? InComponentTransform.TransformPosition(TargetLocation) : TargetLocation;
+	FVector FilteredTarget = bFilterInWorldSpace ? PreviousComponentTransform.TransformPosition(FilteredTargetLocation) : FilteredTargetLocation;
+
+	if (!bTargetFilterInitialized || InDeltaTime <= 0.f)
+	{
+		FilteredTarget = RawTarget;
+		FilteredTargetVelocity = FVector::ZeroVector;
+	}
+	else if (TargetFilter == EASTargetFilter::Spring)
+	{
+		// Critically damped spring, solved exactly so it stays stable with large delta times
+		const float HalfDamping = (2.f * FMath::Loge(2.f)) / SpringHalfLife;
+		const FVector Offset = FilteredTarget - RawTarget;
+		const FVector Impulse = FilteredTargetVelocity + Offset * HalfDamping;
+		const float Decay = FMath::Exp(-HalfDamping * InDeltaTime);
+
+		FilteredTarget = RawTarget + Decay * (Offset + Impulse * InDeltaTime);
+		FilteredTargetVelocity = Decay * (FilteredTargetVelocity - Impulse * HalfDamping * InDeltaTime);
+	}
+	else if (TargetFilter == EASTargetFilter::OneEuro)
+	{
+		auto SmoothingAlpha = [InDeltaTime](float Cutoff)
+		{
+			const float Tau = 1.f / (2.f * PI * Cutoff);
+			return 1.f / (1.f + Tau / InDeltaTime);
+		};
+
+		// Velocity is smoothed with a fixed 1Hz cutoff, then drives the position cutoff
+		const FVector RawVelocity = (RawTarget - FilteredTarget) / InDeltaTime;
+		FilteredTargetVelocity = FMath::Lerp(FilteredTargetVelocity, RawVelocity, SmoothingAlpha(1.f));
+
+		const float Cutoff = OneEuroMinCutoff + OneEuroBeta * FilteredTargetVelocity.Size();
+		FilteredTarget = FMath::Lerp(FilteredTarget, RawTarget, SmoothingAlpha(Cutoff));
+	}
+
+	FilteredTargetLocation = bFilterInWorldSpace ? InComponentTransform.InverseTransformPosition(FilteredTarget) : FilteredTarget;
+	PreviousComponentTransform = InComponentTransform;
+	bTargetFilterInitialized = true;
 }
 
 void FASAnimNode_FABRIK::InitializeBoneReferences(const FBoneContainer& RequiredBones)
@@ -218,9 +365,11 @@ bool FASAnimNode_FABRIK::FillBoneIndices(const FComponentSpacePoseContext& InPos
 	const FCompactPoseBoneIndex FromBoneIndex = FromBone.GetCompactPoseIndex(BoneContainer);
 	FCompactPoseBoneIndex ToBoneIndex = ToBone.GetCompactPoseIndex(BoneContainer);
 
+	// Walk up from the effector, then flip the chain once instead of inserting at the front for every bone
+	OutBoneIndices.Reset();
 	while (FromBoneIndex != ToBoneIndex && !ToBoneIndex.IsRootBone())
 	{
-		OutBoneIndices.Insert(ToBoneIndex, 0);
+		OutBoneIndices.Add(ToBoneIndex);
 		ToBoneIndex = InPoseContext.Pose.GetPose().GetParentBoneIndex(ToBoneIndex);
 	}
 
@@ -231,13 +380,20 @@ bool FASAnimNode_FABRIK::FillBoneIndices(const FComponentSpacePoseContext& InPos
 	}
 #endif // UE_ALLOW_DEBUG
 
-	OutBoneIndices.Insert(ToBoneIndex, 0);
+	OutBoneIndices.Add(ToBoneIndex);
+	Algo::Reverse(OutBoneIndices);
 	return FromBoneIndex == ToBoneIndex;
 }
 
 void FASAnimNode_FABRIK::BuildBoneData(const TArray<FCompactPoseBoneIndex>& InBoneIndices, FComponentSpacePoseContext& InPoseContext, TArray<FASBoneData>& OutBoneData) const
 {
-	for (int32 Index = 0; Index < InBoneIndices.Num(); ++Index)
+	const int32 NumBones = InBoneIndices.Num();
+	OutBoneData.Reset(NumBones);
+
+	// Bones are read once, from root to effector. Component space conversion is recursive and cached,
+	// and goes through the pose so that edits made by earlier skeletal controls are preserved
+	FVector ParentLocation = FVector::ZeroVector;
+	for (int32 Index = 0; Index < NumBones; ++Index)
 	{
 		const FCompactPoseBoneIndex& BoneIndex = InBoneIndices[Index];
 
@@ -246,15 +402,9 @@ void FASAnimNode_FABRIK::BuildBoneData(const TArray<FCompactPoseBoneIndex>& InBo
 		BoneData.BoneTransform = BoneTransform;
 		BoneData.Constraint = BoneIndexToConstraint.FindRef(BoneIndex.GetInt());
 
-		if (Index > 0)
-		{
-			const FCompactPoseBoneIndex& ParentBoneIndex = InBoneIndices[Index - 1];
-			const FTransform& ParentBoneTransform = InPoseContext.Pose.GetComponentSpaceTransform(ParentBoneIndex);
-			BoneData.Length = FVector::Dist(ParentBoneTransform.GetTranslation(), BoneTransform.GetTranslation());
-		}
-		else
-		{
-			BoneData.Length = 0.f;
-		}
+		// Reuse the parent location we just read rather than querying the pose again
+		const FVector BoneLocation = BoneTransform.GetTranslation();
+		BoneData.Length = Index > 0 ? FVector::Dist(ParentLocation, BoneLocation) : 0.f;
+		ParentLocation = BoneLocation;
 	}
 }
\ No newline at end of file
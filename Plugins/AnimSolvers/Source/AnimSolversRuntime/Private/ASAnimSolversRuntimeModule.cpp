@@ -2,14 +2,28 @@
 
 #include "ASAnimSolversRuntimeModule.h"
 
+/// UE4
+#include "Misc/CoreDelegates.h"
+
+/// AnimSolvers
+#include "ASSolverSettings.h"
+
 #define LOCTEXT_NAMESPACE "AnimSolversRuntimeNS"
 
 void FAnimSolversRuntimeModule::StartupModule()
 {
+	FASSolverSettings::Refresh();
+	BeginFrameHandle = FCoreDelegates::OnBeginFrame.AddRaw(this, &FAnimSolversRuntimeModule::OnBeginFrame);
 }
 
 void FAnimSolversRuntimeModule::ShutdownModule()
 {
+	FCoreDelegates::OnBeginFrame.Remove(BeginFrameHandle);
+}
+
+void FAnimSolversRuntimeModule::OnBeginFrame()
+{
+	FASSolverSettings::Refresh();
 }
 
 #undef LOCTEXT_NAMESPACE
@@ -0,0 +1,181 @@
+// Created by Paul Baudy
+
+#include "ASCrowdIK.h"
+
+/// UE4
+#include "Async/ParallelFor.h"
+
+/// AnimSolvers
+#include "ASAnimNode_FABRIK.h"
+#include "ASBoneData.h"
+#include "ASSolverSettings.h"
+
+DECLARE_STATS_GROUP(TEXT("AnimSolvers_Crowd"), STATGROUP_ANIMSOLVERS_CROWD, STATCAT_Advanced);
+DECLARE_CYCLE_STAT(TEXT("CrowdIK_Solve"), STAT_CrowdIK_Solve, STATGROUP_ANIMSOLVERS_CROWD);
+DECLARE_DWORD_COUNTER_STAT(TEXT("CrowdIK_NumChains"), STAT_CrowdIK_NumChains, STATGROUP_ANIMSOLVERS_CROWD);
+
+int32 FASCrowdIKManager::AddInstance(TArrayView<const int32> InParentSlots)
+{
+	const int32 NumBones = InParentSlots.Num();
+	check(NumBones > 0);
+
+	const int32 FirstBone = InputPoses.Num();
+	for (int32 Slot = 0; Slot < NumBones; ++Slot)
+	{
+		const int32 ParentSlot = InParentSlots[Slot];
+		check(ParentSlot < Slot);
+		ParentBones.Add(ParentSlot == INDEX_NONE ? INDEX_NONE : FirstBone + ParentSlot);
+	}
+
+	InstanceFirstBones.Add(FirstBone);
+	InstanceNumBones.Add(NumBones);
+	InputPoses.AddDefaulted(NumBones);
+	SolvedPoses.AddDefaulted(NumBones);
+	ModifiedBones.AddZeroed(NumBones);
+	return InstanceHasPose.Add(false);
+}
+
+int32 FASCrowdIKManager::AddChain(int32 InInstanceIndex, TArrayView<const int32> InBoneSlots)
+{
+	const int32 FirstBone = InstanceFirstBones[InInstanceIndex];
+	const int32 NumInstanceBones = InstanceNumBones[InInstanceIndex];
+
+	ChainInstances.Add(InInstanceIndex);
+	ChainFirstSlots.Add(ChainSlots.Num());
+	ChainNumBones.Add(InBoneSlots.Num());
+	ChainTargets.Add(FVector::ZeroVector);
+
+	for (const int32 BoneSlot : InBoneSlots)
+	{
+		check(BoneSlot >= 0 && BoneSlot < NumInstanceBones);
+		ChainSlots.Add(FirstBone + BoneSlot);
+	}
+
+	return ChainEnabled.Add(true);
+}
+
+void FASCrowdIKManager::Reset()
+{
+	InstanceFirstBones.Reset();
+	InstanceNumBones.Reset();
+	InstanceHasPose.Reset();
+
+	ChainInstances.Reset();
+	ChainFirstSlots.Reset();
+	ChainNumBones.Reset();
+	ChainTargets.Reset();
+	ChainEnabled.Reset();
+	ChainSlots.Reset();
+
+	InputPoses.Reset();
+	SolvedPoses.Reset();
+	ParentBones.Reset();
+	ModifiedBones.Reset();
+}
+
+void FASCrowdIKManager::SetInstancePose(int32 InInstanceIndex, TArrayView<const FTransform> InComponentSpacePose)
+{
+	const int32 NumBones = InstanceNumBones[InInstanceIndex];
+	check(InComponentSpacePose.Num() == NumBones);
+
+	FMemory::Memcpy(&InputPoses[InstanceFirstBones[InInstanceIndex]], InComponentSpacePose.GetData(), NumBones * sizeof(FTransform));
+	InstanceHasPose[InInstanceIndex] = true;
+}
+
+void FASCrowdIKManager::SetChainTarget(int32 InChainIndex, const FVector& InTargetLocation)
+{
+	ChainTargets[InChainIndex] = InTargetLocation;
+}
+
+void FASCrowdIKManager::SetChainEnabled(int32 InChainIndex, bool bInEnabled)
+{
+	ChainEnabled[InChainIndex] = bInEnabled;
+}
+
+void FASCrowdIKManager::Solve(float InPrecision, int32 InMaxIteration)
+{
+	SCOPE_CYCLE_COUNTER(STAT_CrowdIK_Solve);
+
+	const int32 NumChains = GetNumChains();
+	SET_DWORD_STAT(STAT_CrowdIK_NumChains, NumChains);
+
+	// Bones outside of any chain, and chains we skip, keep their input pose
+	if (InputPoses.Num() > 0)
+	{
+		FMemory::Memcpy(SolvedPoses.GetData(), InputPoses.GetData(), InputPoses.Num() * sizeof(FTransform));
+		FMemory::Memzero(ModifiedBones.GetData(), ModifiedBones.Num() * sizeof(bool));
+	}
+
+	const FASSolverSettings& Settings = FASSolverSettings::Get();
+	if (!Settings.bEnabled)
+	{
+		return;
+	}
+
+	const float Precision = Settings.ScaleTolerance(InPrecision);
+	const int32 MaxIteration = Settings.ScaleMaxIteration(InMaxIteration);
+
+	const int32 NumBatches = FMath::DivideAndRoundUp(NumChains, ChainsPerBatch);
+	ParallelFor(NumBatches, [this, NumChains, Precision, MaxIteration](int32 BatchIndex)
+	{
+		// Scratch arrays are shared by every chain of the batch so we only allocate once per task
+		TArray<FASBoneData> BoneData;
+		TArray<FTransform> SolvedTransforms;
+
+		const int32 FirstChain = BatchIndex * ChainsPerBatch;
+		const int32 LastChain = FMath::Min(FirstChain + ChainsPerBatch, NumChains);
+		for (int32 ChainIndex = FirstChain; ChainIndex < LastChain; ++ChainIndex)
+		{
+			const int32 NumBones = ChainNumBones[ChainIndex];
+			if (!ChainEnabled[ChainIndex] || !InstanceHasPose[ChainInstances[ChainIndex]] || NumBones <= 1)
+			{
+				continue;
+			}
+
+			// Gather the chain from its instance pose
+			const int32* Slots = &ChainSlots[ChainFirstSlots[ChainIndex]];
+			BoneData.Reset(NumBones);
+			for (int32 Index = 0; Index < NumBones; ++Index)
+			{
+				FASBoneData& Bone = BoneData.AddDefaulted_GetRef();
+				Bone.BoneTransform = InputPoses[Slots[Index]];
+				Bone.Length = Index > 0 ? FVector::Dist(BoneData[Index - 1].BoneTransform.GetTranslation(), Bone.BoneTransform.GetTranslation()) : 0.f;
+			}
+
+			FABRIKSolver::SolveFABRIK(BoneData, ChainTargets[ChainIndex], Precision, MaxIteration, SolvedTransforms);
+			FABRIKSolver::ApplyChainRotations(BoneData, SolvedTransforms);
+
+			// Scatter the result back into the instance output range
+			for (int32 Index = 0; Index < NumBones; ++Index)
+			{
+				SolvedPoses[Slots[Index]] = SolvedTransforms[Index];
+				ModifiedBones[Slots[Index]] = true;
+			}
+		}
+	});
+
+	// Bones below a solved bone that are not part of a chain keep their local transform and follow their parent.
+	// Parents come before their children, so a single pass per instance propagates through the whole hierarchy
+	ParallelFor(GetNumInstances(), [this](int32 InstanceIndex)
+	{
+		const int32 FirstBone = InstanceFirstBones[InstanceIndex];
+		const int32 LastBone = FirstBone + InstanceNumBones[InstanceIndex];
+		for (int32 Bone = FirstBone; Bone < LastBone; ++Bone)
+		{
+			const int32 ParentBone = ParentBones[Bone];
+			if (ModifiedBones[Bone] || ParentBone == INDEX_NONE || !ModifiedBones[ParentBone])
+			{
+				continue;
+			}
+
+			const FTransform LocalTransform = InputPoses[Bone].GetRelativeTransform(InputPoses[ParentBone]);
+			SolvedPoses[Bone] = LocalTransform * SolvedPoses[ParentBone];
+			ModifiedBones[Bone] = true;
+		}
+	});
+}
+
+TArrayView<const FTransform> FASCrowdIKManager::GetInstancePose(int32 InInstanceIndex) const
+{
+	return TArrayView<const FTransform>(&SolvedPoses[InstanceFirstBones[InInstanceIndex]], InstanceNumBones[InInstanceIndex]);
+}
@@ -0,0 +1,397 @@
+// Created by Paul Baudy
+
+#include "ASFABRIKCapture.h"
+
+/// UE4
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+/// AnimSolvers
+#include "ASAnimNode_FABRIK.h"
+#include "ASBoneData.h"
+
+DEFINE_LOG_CATEGORY(LogASCapture);
+
+#if AS_FABRIK_CAPTURE
+
+namespace FABRIKCaptureEncoding
+{
+	enum class ERecordType : uint8
+	{
+		Chain,
+		Solve,
+	};
+
+	/** Translation, rotation and scale of a bone */
+	constexpr int32 FloatsPerBone = 10;
+
+	/** Target location and tolerance */
+	constexpr int32 FloatsPerSolve = 4;
+
+	int32 GetNumFloats(int32 NumBones)
+	{
+		return FloatsPerSolve + NumBones * FloatsPerBone;
+	}
+
+	/** LEB128 : 7 bits per byte, the high bit flags that more bytes follow */
+	void WriteVarUInt(FArchive& Ar, uint64 Value)
+	{
+		do
+		{
+			uint8 Byte = Value & 0x7f;
+			Value >>= 7;
+			if (Value != 0)
+			{
+				Byte |= 0x80;
+			}
+			Ar << Byte;
+		}
+		while (Value != 0);
+	}
+
+	uint64 ReadVarUInt(FArchive& Ar)
+	{
+		uint64 Value = 0;
+		int32 Shift = 0;
+		uint8 Byte = 0;
+		do
+		{
+			Ar << Byte;
+			Value |= uint64(Byte & 0x7f) << Shift;
+			Shift += 7;
+		}
+		while ((Byte & 0x80) != 0 && Shift < 64 && !Ar.IsError());
+		return Value;
+	}
+
+	/** Zigzag encoding keeps small negative deltas small */
+	void WriteVarInt(FArchive& Ar, int64 Value)
+	{
+		WriteVarUInt(Ar, (uint64(Value) << 1) ^ uint64(Value >> 63));
+	}
+
+	int64 ReadVarInt(FArchive& Ar)
+	{
+		const uint64 Value = ReadVarUInt(Ar);
+		return int64(Value >> 1) ^ -int64(Value & 1);
+	}
+
+	void WriteDeltaFloat(FArchive& Ar, float Value, uint32& PreviousBits)
+	{
+		uint32 Bits = 0;
+		FMemory::Memcpy(&Bits, &Value, sizeof(float));
+		WriteVarUInt(Ar, Bits ^ PreviousBits);
+		PreviousBits = Bits;
+	}
+
+	float ReadDeltaFloat(FArchive& Ar, uint32& PreviousBits)
+	{
+		const uint32 Bits = uint32(ReadVarUInt(Ar)) ^ PreviousBits;
+		PreviousBits = Bits;
+
+		float Value = 0.f;
+		FMemory::Memcpy(&Value, &Bits, sizeof(float));
+		return Value;
+	}
+
+	void WriteDeltaVector(FArchive& Ar, const FVector& Value, uint32*& PreviousBits)
+	{
+		WriteDeltaFloat(Ar, Value.X, *PreviousBits++);
+		WriteDeltaFloat(Ar, Value.Y, *PreviousBits++);
+		WriteDeltaFloat(Ar, Value.Z, *PreviousBits++);
+	}
+
+	FVector ReadDeltaVector(FArchive& Ar, uint32*& PreviousBits)
+	{
+		FVector Value;
+		Value.X = ReadDeltaFloat(Ar, *PreviousBits++);
+		Value.Y = ReadDeltaFloat(Ar, *PreviousBits++);
+		Value.Z = ReadDeltaFloat(Ar, *PreviousBits++);
+		return Value;
+	}
+}
+
+namespace FABRIKCaptureCommands
+{
+	FString GetFilePath(const TArray<FString>& Args)
+	{
+		if (Args.Num() > 0)
+		{
+			return Args[0];
+		}
+		return FPaths::ProjectSavedDir() / TEXT("Profiling") / TEXT("FABRIKCapture.bin");
+	}
+
+	static FAutoConsoleCommand StartCommand(
+		TEXT("a.AnimSolvers.FABRIK.CaptureStart"),
+		TEXT("Starts recording FABRIK node inputs. Optional argument : output file path."),
+		FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+		{
+			FASFABRIKCapture::Get().Start(GetFilePath(Args));
+		}));
+
+	static FAutoConsoleCommand StopCommand(
+		TEXT("a.AnimSolvers.FABRIK.CaptureStop"),
+		TEXT("Stops recording FABRIK node inputs."),
+		FConsoleCommandDelegate::CreateLambda([]()
+		{
+			FASFABRIKCapture::Get().Stop();
+		}));
+
+	static FAutoConsoleCommand ReplayCommand(
+		TEXT("a.AnimSolvers.FABRIK.Replay"),
+		TEXT("Replays a FABRIK capture through the solver and logs timings. Optional argument : capture file path."),
+		FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+		{
+			FASFABRIKReplayStats Stats;
+			if (FASFABRIKCapture::Replay(GetFilePath(Args), Stats) && Stats.NumSolves > 0)
+			{
+				UE_LOG(LogASCapture, Display, TEXT("Replayed %d solves : total %.1f us, average %.2f us, max %.2f us (frame %llu, chain %s)"),
+					Stats.NumSolves, Stats.TotalMicroseconds, Stats.TotalMicroseconds / Stats.NumSolves, Stats.MaxMicroseconds, Stats.MaxFrame, *Stats.MaxChain);
+			}
+		}));
+}
+
+FASFABRIKCapture& FASFABRIKCapture::Get()
+{
+	static FASFABRIKCapture Instance;
+	return Instance;
+}
+
+bool FASFABRIKCapture::Start(const FString& InFilePath)
+{
+	Stop();
+
+	FScopeLock Lock(&CaptureLock);
+	FileWriter.Reset(IFileManager::Get().CreateFileWriter(*InFilePath));
+	if (!FileWriter.IsValid())
+	{
+		UE_LOG(LogASCapture, Warning, TEXT("Could not open capture file %s"), *InFilePath);
+		return false;
+	}
+
+	uint32 Magic = FileMagic;
+	int32 Version = FileVersion;
+	*FileWriter << Magic;
+	*FileWriter << Version;
+
+	Chains.Reset();
+	NextChainId = 0;
+	PreviousFrame = 0;
+	bCapturing = true;
+
+	UE_LOG(LogASCapture, Display, TEXT("Started FABRIK capture to %s"), *InFilePath);
+	return true;
+}
+
+void FASFABRIKCapture::Stop()
+{
+	FScopeLock Lock(&CaptureLock);
+	bCapturing = false;
+
+	if (FileWriter.IsValid())
+	{
+		FileWriter->Close();
+		FileWriter.Reset();
+		UE_LOG(LogASCapture, Display, TEXT("Stopped FABRIK capture"));
+	}
+}
+
+void FASFABRIKCapture::RecordSolve(const void* InChainKey, const FName& InRootBone, const FName& InEffectorBone, const TArray<FASBoneData>& InBoneData, const FVector& InTargetLocation, float InTolerance, int32 InMaxIteration)
+{
+	using namespace FABRIKCaptureEncoding;
+
+	if (!bCapturing)
+	{
+		return;
+	}
+
+	const int32 NumBones = InBoneData.Num();
+	const uint64 Frame = GFrameCounter;
+
+	// Encoding depends on the previous record of each chain, so the whole record is built under the lock
+	FScopeLock Lock(&CaptureLock);
+	if (!FileWriter.IsValid())
+	{
+		return;
+	}
+
+	RecordBuffer.Reset();
+	FMemoryWriter Writer(RecordBuffer);
+
+	// A node whose chain changed size is registered again, its previous values no longer line up
+	FChainState* Chain = Chains.Find(InChainKey);
+	if (Chain == nullptr || Chain->NumBones != NumBones)
+	{
+		Chain = &Chains.Add(InChainKey);
+		Chain->Id = NextChainId++;
+		Chain->NumBones = NumBones;
+		Chain->Name = FString::Printf(TEXT("%s->%s"), *InRootBone.ToString(), *InEffectorBone.ToString());
+		Chain->PreviousBits.SetNumZeroed(GetNumFloats(NumBones));
+
+		uint8 RecordType = uint8(ERecordType::Chain);
+		Writer << RecordType;
+		WriteVarUInt(Writer, Chain->Id);
+		Writer << Chain->Name;
+		WriteVarUInt(Writer, NumBones);
+	}
+
+	uint8 RecordType = uint8(ERecordType::Solve);
+	Writer << RecordType;
+	WriteVarUInt(Writer, Chain->Id);
+	WriteVarInt(Writer, int64(Frame - PreviousFrame));
+	WriteVarUInt(Writer, FMath::Max(InMaxIteration, 0));
+	PreviousFrame = Frame;
+
+	uint32* PreviousBits = Chain->PreviousBits.GetData();
+	WriteDeltaVector(Writer, InTargetLocation, PreviousBits);
+	WriteDeltaFloat(Writer, InTolerance, *PreviousBits++);
+
+	for (const FASBoneData& BoneData : InBoneData)
+	{
+		const FTransform& BoneTransform = BoneData.BoneTransform;
+		const FQuat Rotation = BoneTransform.GetRotation();
+		WriteDeltaVector(Writer, BoneTransform.GetTranslation(), PreviousBits);
+		WriteDeltaFloat(Writer, Rotation.X, *PreviousBits++);
+		WriteDeltaFloat(Writer, Rotation.Y, *PreviousBits++);
+		WriteDeltaFloat(Writer, Rotation.Z, *PreviousBits++);
+		WriteDeltaFloat(Writer, Rotation.W, *PreviousBits++);
+		WriteDeltaVector(Writer, BoneTransform.GetScale3D(), PreviousBits);
+	}
+
+	FileWriter->Serialize(RecordBuffer.GetData(), RecordBuffer.Num());
+}
+
+bool FASFABRIKCapture::Replay(const FString& InFilePath, FASFABRIKReplayStats& OutStats)
+{
+	using namespace FABRIKCaptureEncoding;
+
+	TArray<uint8> FileData;
+	if (!FFileHelper::LoadFileToArray(FileData, *InFilePath))
+	{
+		UE_LOG(LogASCapture, Warning, TEXT("Could not read capture file %s"), *InFilePath);
+		return false;
+	}
+
+	FMemoryReader Reader(FileData);
+	uint32 Magic = 0;
+	int32 Version = 0;
+	Reader << Magic;
+	Reader << Version;
+	if (Magic != FileMagic || Version != FileVersion)
+	{
+		UE_LOG(LogASCapture, Warning, TEXT("%s is not a supported FABRIK capture"), *InFilePath);
+		return false;
+	}
+
+	TMap<uint32, FChainState> Chains;
+	uint64 Frame = 0;
+	TArray<FASBoneData> BoneData;
+	TArray<FTransform> SolvedTransforms;
+
+	while (!Reader.AtEnd() && !Reader.IsError())
+	{
+		uint8 RecordType = 0;
+		Reader << RecordType;
+
+		if (RecordType == uint8(ERecordType::Chain))
+		{
+			const uint32 ChainId = uint32(ReadVarUInt(Reader));
+			FChainState& Chain = Chains.Add(ChainId);
+			Chain.Id = ChainId;
+			Reader << Chain.Name;
+			const uint64 NumBones = ReadVarUInt(Reader);
+
+			if (Reader.IsError())
+			{
+				break;
+			}
+
+			// Every bone takes at least one byte per float, so a count the rest of the file cannot hold is corrupted
+			const int64 RemainingBytes = Reader.TotalSize() - Reader.Tell();
+			if (NumBones <= 1 || NumBones > uint64(RemainingBytes / FloatsPerBone))
+			{
+				UE_LOG(LogASCapture, Warning, TEXT("Corrupted capture : invalid bone count %llu for chain %u"), NumBones, ChainId);
+				return false;
+			}
+
+			Chain.NumBones = int32(NumBones);
+			Chain.PreviousBits.SetNumZeroed(GetNumFloats(Chain.NumBones));
+			continue;
+		}
+
+		if (RecordType != uint8(ERecordType::Solve))
+		{
+			UE_LOG(LogASCapture, Warning, TEXT("Corrupted capture : unknown record type %d"), RecordType);
+			return false;
+		}
+
+		const uint32 ChainId = uint32(ReadVarUInt(Reader));
+		if (Reader.IsError())
+		{
+			break;
+		}
+
+		FChainState* Chain = Chains.Find(ChainId);
+		if (Chain == nullptr)
+		{
+			UE_LOG(LogASCapture, Warning, TEXT("Corrupted capture : solve references unknown chain %u"), ChainId);
+			return false;
+		}
+
+		Frame += ReadVarInt(Reader);
+		const int32 MaxIteration = int32(ReadVarUInt(Reader));
+
+		uint32* PreviousBits = Chain->PreviousBits.GetData();
+		const FVector TargetLocation = ReadDeltaVector(Reader, PreviousBits);
+		const float Tolerance = ReadDeltaFloat(Reader, *PreviousBits++);
+
+		// Lengths are derived from the transforms, the same way the node builds its bone data
+		BoneData.Reset(Chain->NumBones);
+		for (int32 Index = 0; Index < Chain->NumBones; ++Index)
+		{
+			const FVector Translation = ReadDeltaVector(Reader, PreviousBits);
+			FQuat Rotation;
+			Rotation.X = ReadDeltaFloat(Reader, *PreviousBits++);
+			Rotation.Y = ReadDeltaFloat(Reader, *PreviousBits++);
+			Rotation.Z = ReadDeltaFloat(Reader, *PreviousBits++);
+			Rotation.W = ReadDeltaFloat(Reader, *PreviousBits++);
+			const FVector Scale = ReadDeltaVector(Reader, PreviousBits);
+
+			FASBoneData& Bone = BoneData.AddDefaulted_GetRef();
+			Bone.BoneTransform = FTransform(Rotation, Translation, Scale);
+			Bone.Length = Index > 0 ? FVector::Dist(BoneData[Index - 1].BoneTransform.GetTranslation(), Translation) : 0.f;
+		}
+
+		if (Reader.IsError())
+		{
+			UE_LOG(LogASCapture, Warning, TEXT("Truncated capture : last record of chain %s is incomplete, reporting the %d solves read before it"), *Chain->Name, OutStats.NumSolves);
+			return true;
+		}
+
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		FABRIKSolver::SolveFABRIK(BoneData, TargetLocation, Tolerance, MaxIteration, SolvedTransforms);
+		const double Microseconds = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StartCycles) * 1000.0;
+
+		++OutStats.NumSolves;
+		OutStats.TotalMicroseconds += Microseconds;
+		if (Microseconds > OutStats.MaxMicroseconds)
+		{
+			OutStats.MaxMicroseconds = Microseconds;
+			OutStats.MaxFrame = Frame;
+			OutStats.MaxChain = Chain->Name;
+		}
+	}
+
+	if (Reader.IsError())
+	{
+		UE_LOG(LogASCapture, Warning, TEXT("Truncated capture : reporting the %d solves read before the end of the file"), OutStats.NumSolves);
+	}
+	return true;
+}
+
+#endif // AS_FABRIK_CAPTURE
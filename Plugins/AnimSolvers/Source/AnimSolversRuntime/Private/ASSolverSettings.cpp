@@ -0,0 +1,44 @@
+// Created by Paul Baudy
+
+#include "ASSolverSettings.h"
+
+/// UE4
+#include "HAL/IConsoleManager.h"
+
+namespace ASSolverSettingsCVars
+{
+	static TAutoConsoleVariable<int32> CVarEnable(
+		TEXT("a.AnimSolvers.Enable"),
+		1,
+		TEXT("Enables AnimSolvers IK solvers. When disabled, solver nodes pass their input pose through."),
+		ECVF_Scalability);
+
+	static TAutoConsoleVariable<float> CVarMaxIterationsScale(
+		TEXT("a.AnimSolvers.MaxIterationsScale"),
+		1.f,
+		TEXT("Multiplier applied to the maximum iteration count of every AnimSolvers solver."),
+		ECVF_Scalability);
+
+	static TAutoConsoleVariable<float> CVarToleranceScale(
+		TEXT("a.AnimSolvers.ToleranceScale"),
+		1.f,
+		TEXT("Multiplier applied to the tolerance of every AnimSolvers solver. Higher values stop solvers earlier."),
+		ECVF_Scalability);
+
+	static FASSolverSettings Settings;
+}
+
+const FASSolverSettings& FASSolverSettings::Get()
+{
+	return ASSolverSettingsCVars::Settings;
+}
+
+void FASSolverSettings::Refresh()
+{
+	check(IsInGameThread());
+
+	FASSolverSettings& Settings = ASSolverSettingsCVars::Settings;
+	Settings.bEnabled = ASSolverSettingsCVars::CVarEnable.GetValueOnGameThread() != 0;
+	Settings.MaxIterationsScale = FMath::Max(0.f, ASSolverSettingsCVars::CVarMaxIterationsScale.GetValueOnGameThread());
+	Settings.ToleranceScale = FMath::Max(0.f, ASSolverSettingsCVars::CVarToleranceScale.GetValueOnGameThread());
+}
@@ -8,11 +8,25 @@
 
 /// AnimSolvers
 #include "ASBoneConstraint.h"
+#include "ASBoneData.h"
 
 #include "ASAnimNode_FABRIK.generated.h"
 
 DECLARE_LOG_CATEGORY_EXTERN(LogASFABRIK, Log, All);
 
+/** Outcome of a single FABRIK solve */
+struct FASFABRIKSolveResult
+{
+	/** Number of forward/backward passes the solver ran */
+	int32 Iterations = 0;
+
+	/** Distance left between the end effector and the target location */
+	float Residual = 0.f;
+
+	/** Whether the residual ended up within the requested precision */
+	bool bConverged = true;
+};
+
 namespace FABRIKSolver
 {
 	/** 
@@ -24,8 +38,9 @@ namespace FABRIKSolver
 	* @param	InPrecision : Precision of the algorithm, which is the distance we allow between the end effector and our target location
 	* @param	InMaxIteration : Maximum number of passes
 	* @return	OutBoneTransforms : The modified bone transforms
+	* @return	Iteration count and residual of the solve
 	*/
-	void SolveFABRIK(const TArray<FASBoneData>& InBoneDataArr, const FVector& TargetLocation, const float& InPrecision, const int32 InMaxIteration, TArray<FTransform>& OutBoneTransforms);
+	FASFABRIKSolveResult SolveFABRIK(const TArray<FASBoneData>& InBoneDataArr, const FVector& TargetLocation, const float& InPrecision, const int32 InMaxIteration, TArray<FTransform>& OutBoneTransforms);
 	
 	/**
 	* Forward pass of the FABRIK algorithm.
@@ -56,8 +71,31 @@ namespace FABRIKSolver
 	* @return	InMovingBone : The bone that should maintain its distance with InParentBone
 	*/
 	void OffsetPoint(FTransform& InMovingBone, float InLength, const FTransform& InStaticBone);
+
+	/**
+	* Rotates each solved bone so that it points towards its solved child again.
+	* The solver only moves bone locations, this rebuilds the matching orientations
+	*
+	* @param	InBoneData : The bone chain data the solver started from
+	* @return	OutBoneTransforms : The solved bone transforms, with corrected rotations
+	*/
+	void ApplyChainRotations(const TArray<FASBoneData>& InBoneData, TArray<FTransform>& OutBoneTransforms);
 }
 
+/** Filters that can be applied to the target location before it reaches the solver */
+UENUM()
+enum class EASTargetFilter : uint8
+{
+	/** The target location is used as is */
+	None,
+	/** Critically damped spring following the target */
+	Spring,
+	/** One euro filter : strong smoothing for slow targets, low latency for fast ones */
+	OneEuro,
+	/** Extrapolates the target against the component's motion, compensating root motion latency */
+	Prediction,
+};
+
 /**
 *	Skeletal controller used to implement the runtime logic of the FABRIK Anim Node
 */
@@ -71,6 +109,10 @@ public:
 	virtual void EvaluateSkeletalControl_AnyThread(FComponentSpacePoseContext& Output, TArray<FBoneTransform>& OutBoneTransforms) override;
 	virtual bool IsValidToEvaluate(const USkeleton* Skeleton, const FBoneContainer& RequiredBones) override;
 	virtual void InitializeBoneReferences(const FBoneContainer& RequiredBones) override;
+	virtual void Initialize_AnyThread(const FAnimationInitializeContext& Context) override;
+	virtual void UpdateInternal(const FAnimationUpdateContext& Context) override;
+	virtual bool NeedsDynamicReset() const override;
+	virtual void ResetDynamics(ETeleportType InTeleportType) override;
 	// ~End FAnimNode_SkeletalControlBase Interface
 
 	/** Location we're trying to reach with our effector bone */
@@ -97,15 +139,94 @@ public:
 	UPROPERTY(EditAnywhere, Category = Solver)
 	int32 MaxIteration = 20;
 
+	/** Filter applied to the target location. Keeping per-frame target deltas small lets the solver converge in fewer passes */
+	UPROPERTY(EditAnywhere, Category = TargetFilter)
+	EASTargetFilter TargetFilter = EASTargetFilter::None;
+
+	/** Filter in world space so that root motion moving the component does not show up as target motion */
+	UPROPERTY(EditAnywhere, Category = TargetFilter, meta = (EditCondition = "TargetFilter == EASTargetFilter::Spring || TargetFilter == EASTargetFilter::OneEuro"))
+	bool bFilterInWorldSpace = true;
+
+	/** Time in seconds for the spring to cover half the distance to the target */
+	UPROPERTY(EditAnywhere, Category = TargetFilter, meta = (ClampMin = "0.001", EditCondition = "TargetFilter == EASTargetFilter::Spring"))
+	float SpringHalfLife = 0.05f;
+
+	/** Cutoff frequency in Hz used when the target is still. Lower values smooth more */
+	UPROPERTY(EditAnywhere, Category = TargetFilter, meta = (ClampMin = "0.001", EditCondition = "TargetFilter == EASTargetFilter::OneEuro"))
+	float OneEuroMinCutoff = 1.f;
+
+	/** How fast the cutoff frequency rises with target speed. Higher values reduce lag on fast targets */
+	UPROPERTY(EditAnywhere, Category = TargetFilter, meta = (ClampMin = "0.0", EditCondition = "TargetFilter == EASTargetFilter::OneEuro"))
+	float OneEuroBeta = 0.01f;
+
+	/** 
+	*  Time in seconds the target is extrapolated ahead. The component motion of the last update, translation and rotation,
+	*  is scaled from that update's delta time to this horizon. One frame is usually enough to hide root motion latency
+	*/
+	UPROPERTY(EditAnywhere, Category = TargetFilter, meta = (ClampMin = "0.0", EditCondition = "TargetFilter == EASTargetFilter::Prediction"))
+	float PredictionTime = 0.033f;
+
 #if WITH_EDITORONLY_DATA
 	UPROPERTY(EditAnywhere, Category = Debug)
 	bool bDrawDebug = false;
+
+	/** Collects the cost, iteration count and residual shown on the editor graph node. Off by default as timing has a cost */
+	UPROPERTY(EditAnywhere, Category = Debug)
+	bool bProfile = false;
+
+	/** Live cost of this node, read by the editor graph node */
+	struct FDebugStats
+	{
+		/** Smoothed evaluation cost in microseconds */
+		float AverageMicroseconds = 0.f;
+
+		/** Iterations used by the last solve */
+		int32 LastIterations = 0;
+
+		/** Residual error of the last solve */
+		float LastResidual = 0.f;
+
+		/** Tolerance the last solve ran with, after global settings scaling */
+		float SolverTolerance = 0.f;
+
+		/** Number of solves that ran out of iterations before reaching the tolerance, since the node was initialized */
+		int32 ConvergenceFailures = 0;
+
+		/** Solved chain locations in component space */
+		TArray<FVector> ChainLocations;
+	};
+
+	const FDebugStats& GetDebugStats() const { return DebugStats; }
 #endif // WITH_EDITORONLY_DATA
 
 private:
+#if WITH_EDITORONLY_DATA
+	FDebugStats DebugStats;
+#endif // WITH_EDITORONLY_DATA
+
+	/** Target location sent to the solver, after filtering */
+	FVector FilteredTargetLocation = FVector::ZeroVector;
+
+	/** Velocity tracked by the spring and one euro filters */
+	FVector FilteredTargetVelocity = FVector::ZeroVector;
+
+	/** Component transform seen during the previous update */
+	FTransform PreviousComponentTransform;
+
+	/** Whether the filter state holds valid data from a previous update */
+	bool bTargetFilterInitialized = false;
+
+	/** Used to detect updates we missed while not relevant, in which case the filter state is stale */
+	FGraphTraversalCounter UpdateCounter;
+
 	/** Cached constraints to allow quick access */
 	TMap<int32, const class UASBoneConstraint*> BoneIndexToConstraint;
 
+	// Scratch arrays reused across evaluations to avoid per-frame allocations
+	TArray<FCompactPoseBoneIndex> BoneIndices;
+	TArray<FASBoneData> BonesToModify;
+	TArray<FTransform> ModifiedBoneTransforms;
+
 	/** 
 	*  Helper function used to build a bone chain from the source bone to the end effector. 
 	*  @param	InPoseContext : The owning pose associated with our skeletal component
@@ -117,7 +238,15 @@ private:
 	*  Helper function used to provide additional data to the FABRIK solver
 	*  @param	InBoneIndices : An array representing our bone chain
 	*  @param	InPoseContext : The owning pose associated with our skeletal component. @note not const because of GetComponentSpaceTransform not being const either.
+	*  @note	Each bone is read once through the component space pose, so edits from earlier skeletal controls are kept
 	*  @return	OutBoneData : An array of FASBoneData providing meta data on bones for the FABRIK solver, such as bone lengths
 	*/
 	void BuildBoneData(const TArray<FCompactPoseBoneIndex>& InBoneIndices, FComponentSpacePoseContext& InPoseContext, TArray<FASBoneData>& OutBoneData) const;
+
+	/**
+	*  Runs the selected target filter and stores the result in FilteredTargetLocation
+	*  @param	InComponentTransform : The skeletal component transform for this update
+	*  @param	InDeltaTime : Time elapsed since the previous update
+	*/
+	void UpdateTargetFilter(const FTransform& InComponentTransform, float InDeltaTime);
 };
@@ -12,4 +12,10 @@ public:
 	/** IModuleInterface implementation */
 	virtual void StartupModule() override;
 	virtual void ShutdownModule() override;
+
+private:
+	/** Refreshes per frame solver settings */
+	void OnBeginFrame();
+
+	FDelegateHandle BeginFrameHandle;
 };
@@ -0,0 +1,92 @@
+// Created by Paul Baudy
+
+#pragma once
+
+/// UE4
+#include "CoreMinimal.h"
+
+/**
+*   Lightweight IK path for crowds that do not run an anim graph.
+*   Instances and their chains are owned by the manager and solved with the FABRIK solver core, outside of any FAnimNode evaluation.
+*   
+*   Each instance owns a contiguous range of bone slots in a packed pose buffer, along with the parent of each slot.
+*   Chains map their bones to slots of their instance, so solved chains are written straight back into the instance's output range.
+*   Bones hanging below a solved bone without being part of a chain then follow it, keeping their local transform.
+*   All data is stored as flat arrays, one entry per bone, per chain or per instance.
+*   @note Transforms are expected in the instance's component space. Chains of the same instance must not share bones
+*/
+class ANIMSOLVERSRUNTIME_API FASCrowdIKManager
+{
+public:
+	/**
+	*  Registers a new instance
+	*  @param	InParentSlots : Parent slot of each bone slot of the instance pose, INDEX_NONE for roots. Parents must come before their children
+	*  @return	Index of the instance
+	*/
+	int32 AddInstance(TArrayView<const int32> InParentSlots);
+
+	/**
+	*  Registers a chain on an instance
+	*  @param	InInstanceIndex : Instance owning the chain
+	*  @param	InBoneSlots : Bone slots of the chain inside the instance pose, ordered from root to effector
+	*  @return	Index of the chain
+	*/
+	int32 AddChain(int32 InInstanceIndex, TArrayView<const int32> InBoneSlots);
+
+	/** Removes every instance and chain */
+	void Reset();
+
+	int32 GetNumInstances() const { return InstanceFirstBones.Num(); }
+	int32 GetNumChains() const { return ChainInstances.Num(); }
+
+	/** 
+	*  Sets the animated pose the instance starts from this frame. Bone lengths are taken from this pose.
+	*  Chains of an instance are not solved until it received a pose
+	*/
+	void SetInstancePose(int32 InInstanceIndex, TArrayView<const FTransform> InComponentSpacePose);
+
+	/** Sets the location the chain effector should reach */
+	void SetChainTarget(int32 InChainIndex, const FVector& InTargetLocation);
+
+	/** Disabled chains keep their input pose and are skipped by the solve */
+	void SetChainEnabled(int32 InChainIndex, bool bInEnabled);
+
+	/**
+	*  Solves every enabled chain, spread over worker threads.
+	*  Precision and iteration count are scaled by the global solver settings
+	*  @param	InPrecision : Distance allowed between each effector and its target
+	*  @param	InMaxIteration : Maximum number of passes per chain
+	*/
+	void Solve(float InPrecision, int32 InMaxIteration);
+
+	/** Instance pose after the solve : the input pose with every solved chain written in */
+	TArrayView<const FTransform> GetInstancePose(int32 InInstanceIndex) const;
+
+private:
+	/** Number of chains solved by a single worker task. Small chains are cheap, so we batch them to amortize scheduling */
+	static constexpr int32 ChainsPerBatch = 64;
+
+	// Per instance data
+	TArray<int32> InstanceFirstBones;
+	TArray<int32> InstanceNumBones;
+	TArray<bool> InstanceHasPose;
+
+	// Per chain data
+	TArray<int32> ChainInstances;
+	TArray<int32> ChainFirstSlots;
+	TArray<int32> ChainNumBones;
+	TArray<FVector> ChainTargets;
+	TArray<bool> ChainEnabled;
+
+	/** Bone slots of every chain packed together, as indices in the pose buffers */
+	TArray<int32> ChainSlots;
+
+	// Per bone data, all instances packed together
+	TArray<FTransform> InputPoses;
+	TArray<FTransform> SolvedPoses;
+
+	/** Parent of each bone, as an index in the pose buffers. INDEX_NONE for roots */
+	TArray<int32> ParentBones;
+
+	/** Bones moved by this frame's solve, either solved in a chain or following a solved parent */
+	TArray<bool> ModifiedBones;
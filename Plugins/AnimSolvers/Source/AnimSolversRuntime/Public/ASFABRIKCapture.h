@@ -0,0 +1,105 @@
+// Created by Paul Baudy
+
+#pragma once
+
+/// UE4
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+
+struct FASBoneData;
+
+/** Captures are a profiling tool, they never make it into shipping builds */
+#define AS_FABRIK_CAPTURE !UE_BUILD_SHIPPING
+
+DECLARE_LOG_CATEGORY_EXTERN(LogASCapture, Log, All);
+
+#if AS_FABRIK_CAPTURE
+
+/** Summary of a capture replay, used to compare solver versions on recorded gameplay data */
+struct ANIMSOLVERSRUNTIME_API FASFABRIKReplayStats
+{
+	/** Number of solves replayed */
+	int32 NumSolves = 0;
+
+	/** Total time spent inside the solver, in microseconds */
+	double TotalMicroseconds = 0.0;
+
+	/** Most expensive single solve, in microseconds */
+	double MaxMicroseconds = 0.0;
+
+	/** Game frame of the most expensive solve */
+	uint64 MaxFrame = 0;
+
+	/** Chain of the most expensive solve */
+	FString MaxChain;
+};
+
+/**
+*   Records the inputs of every FABRIK node evaluation into a binary file so that production spikes can be replayed offline.
+*   
+*   File layout : a header followed by a stream of records. A chain record registers a node's chain once, giving it an id,
+*   a name and a bone count. Solve records then reference the chain by id.
+*   Every float of a solve record is XORed with the same value in the chain's previous solve and written as a variable length
+*   integer. Values that barely move between frames share their sign, exponent and high mantissa bits, so they only take a byte or two.
+*   The encoding is lossless, so replays solve exactly what the live node solved.
+*   Bone lengths are not stored, they are derived from the recorded transforms like the node does.
+*   @note Constraints are UObjects and are not part of the capture, replays are unconstrained solves
+*/
+class ANIMSOLVERSRUNTIME_API FASFABRIKCapture
+{
+public:
+	static FASFABRIKCapture& Get();
+
+	/** Opens the capture file and starts recording. Any running capture is stopped first */
+	bool Start(const FString& InFilePath);
+
+	/** Flushes and closes the capture file */
+	void Stop();
+
+	/** Cheap check performed by the nodes before building a record */
+	bool IsCapturing() const { return bCapturing; }
+
+	/** 
+	*  Appends one solve to the capture. Safe to call from any animation worker thread
+	*  @param	InChainKey : Unique key of the recording node, so that chains sharing bone names on different meshes stay apart
+	*  @param	InRootBone : Root bone of the chain, only used to name the chain in the capture
+	*  @param	InEffectorBone : Effector bone of the chain, only used to name the chain in the capture
+	*  @param	InBoneData : The bone chain data sent to the solver
+	*/
+	void RecordSolve(const void* InChainKey, const FName& InRootBone, const FName& InEffectorBone, const TArray<FASBoneData>& InBoneData, const FVector& InTargetLocation, float InTolerance, int32 InMaxIteration);
+
+	/** 
+	*  Re-runs FABRIKSolver::SolveFABRIK over every record of a capture file
+	*  @return	OutStats : Timings gathered during the replay
+	*/
+	static bool Replay(const FString& InFilePath, FASFABRIKReplayStats& OutStats);
+
+private:
+	static constexpr uint32 FileMagic = 0x43465341; // "ASFC" once written in little endian
+	static constexpr int32 FileVersion = 2;
+
+	/** Encoding state of a chain, mirrored by the replay */
+	struct FChainState
+	{
+		uint32 Id = 0;
+		int32 NumBones = 0;
+		FString Name;
+
+		/** Bits of every float written with the previous solve of this chain */
+		TArray<uint32> PreviousBits;
+	};
+
+	FCriticalSection CaptureLock;
+	TUniquePtr<FArchive> FileWriter;
+
+	TMap<const void*, FChainState> Chains;
+	uint32 NextChainId = 0;
+	uint64 PreviousFrame = 0;
+
+	/** Scratch buffer a record is encoded into before being written to the file */
+	TArray<uint8> RecordBuffer;
+
+	TAtomic<bool> bCapturing { false };
+};
+
+#endif // AS_FABRIK_CAPTURE
@@ -0,0 +1,40 @@
+// Created by Paul Baudy
+
+#pragma once
+
+/// UE4
+#include "CoreMinimal.h"
+
+/**
+*   Global solver quality settings, driven by the a.AnimSolvers.* console variables.
+*   The ViewDistanceQuality scalability group sets them, next to the skeletal mesh LOD bias.
+*   Console variables are read once per frame on the game thread, solvers only ever read this snapshot.
+*/
+struct ANIMSOLVERSRUNTIME_API FASSolverSettings
+{
+	/** Whether solvers should run at all */
+	bool bEnabled = true;
+
+	/** Multiplier applied to every solver's maximum iteration count */
+	float MaxIterationsScale = 1.f;
+
+	/** Multiplier applied to every solver's tolerance */
+	float ToleranceScale = 1.f;
+
+	/** Settings snapshot for the current frame */
+	static const FASSolverSettings& Get();
+
+	/** Reads the console variables into the snapshot. Called at the beginning of every frame by the runtime module */
+	static void Refresh();
+
+	/** Scaled iteration budget. Never goes below a single pass so enabled solvers still make progress */
+	int32 ScaleMaxIteration(int32 InMaxIteration) const
+	{
+		return FMath::Max(1, FMath::RoundToInt(InMaxIteration * MaxIterationsScale));
+	}
+
+	float ScaleTolerance(float InTolerance) const
+	{
+		return InTolerance * ToleranceScale;
+	}
+};